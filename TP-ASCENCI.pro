@@ -1,15 +1,20 @@
 # Qt configuration file
 # Run `qmake` once, then `make`.
 
-QT += widgets
+QT += widgets concurrent
 CONFIG += c++11
+# GCC does not vectorize the kinematics loop of LogicalScene::integrate at
+# plain -O2 (checked with -fopt-info-vec on GCC 12).
+gcc|clang: QMAKE_CXXFLAGS_RELEASE += -ftree-vectorize
 
 HEADERS += \
-        objects.hpp
+        objects.hpp \
+        renderer.hpp
 
 SOURCES += \
         collider.cpp \
-        objects.cpp
+        objects.cpp \
+        renderer.cpp
 
 RESOURCES += \
         collider.qrc
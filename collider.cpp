@@ -10,6 +10,7 @@
 #include <cmath>
 #include <QtWidgets>
 #include "objects.hpp"
+#include "renderer.hpp"
 
 /****************************************************************************
 ** Configuration
@@ -18,10 +19,22 @@
 // Game
 static const char* GameTitle = "Space - the final frontier";
 static const int GameRefresh = 30; // ms
+static const double GameBudget = 20.0; // ms of simulation per tick at most
+static const int MinTested = 10; // fewest random points checked under load
+static const int MetricsPeriod = 5000; // ms between two reports of degradations
+
+// Broad phase: collisions are only checked between shapes that share a
+// cell of a GridCountX x GridCountY grid over the world.
+static const int GridCountX = 4;
+static const int GridCountY = 4;
 
 // Background
 static const char* BackgroundSrc = ":/images/stars.jpg";
 
+// Export (see --help)
+static const char* ExportSize = "1920x1080";
+static const char* ExportFrames = "300";
+
 // Asteroid
 static const int AsteroidCount = 10;
 static const QColor AsteroidOkColor = QColor( 150, 130, 110 );
@@ -43,6 +56,24 @@ int main(int argc, char **argv)
 {
   // Initializes Qt.
   QApplication app(argc, argv);
+  // Reads the command line, to export frames offscreen instead of
+  // showing the game, e.g. `collider -platform offscreen --export frames`.
+  QCommandLineParser parser;
+  parser.setApplicationDescription( GameTitle );
+  parser.addHelpOption();
+  QCommandLineOption exportOption( "export",
+      "Writes the frames into <directory> instead of showing the game.", "directory" );
+  QCommandLineOption framesOption( "frames",
+      "Number of exported frames.", "frames", ExportFrames );
+  QCommandLineOption sizeOption( "size",
+      "Size of the exported frames.", "WxH", ExportSize );
+  QCommandLineOption formatOption( "format",
+      "Format of the exported frames, png or raw (RGB888 rows).", "format", "png" );
+  parser.addOption( exportOption );
+  parser.addOption( framesOption );
+  parser.addOption( sizeOption );
+  parser.addOption( formatOption );
+  parser.process( app );
   // Initializes the random generator.
   qsrand(QTime(0, 0, 0).secsTo(QTime::currentTime()));
 
@@ -53,6 +84,9 @@ int main(int argc, char **argv)
 
   // We choose to check intersection with 100 random points.
   logical_scene = new LogicalScene( 100 );
+  logical_scene->setGrid( GridCountX, GridCountY );
+  logical_scene->budget = GameBudget;
+  logical_scene->min_tested = MinTested;
 
   // Creates a few asteroids...
   for (int i = 0; i < AsteroidCount; ++i) {
@@ -69,7 +103,7 @@ int main(int argc, char **argv)
     // Add it to the graphical scene
     graphical_scene.addItem( asteroid );
     // and to the logical scene
-    logical_scene->formes.push_back( asteroid );
+    logical_scene->add( asteroid );
   }
 
   // Creates a few space trucks...
@@ -86,7 +120,7 @@ int main(int argc, char **argv)
     // Add it to the graphical scene
     graphical_scene.addItem( spaceTruck );
     // and to the logical scene
-    logical_scene->formes.push_back( spaceTruck );
+    logical_scene->add( spaceTruck );
   }
 
   // Creates a few space enterprises...
@@ -103,7 +137,40 @@ int main(int argc, char **argv)
     // Add it to the graphical scene
     graphical_scene.addItem( enterprise );
     // and to the logical scene
-    logical_scene->formes.push_back( enterprise );
+    logical_scene->add( enterprise );
+  }
+
+  // Exports frames as fast as possible, without any view.
+  if ( parser.isSet( exportOption ) ) {
+    const QStringList wh = parser.value( sizeOption ).split( 'x' );
+    const QSize size( wh.value( 0 ).toInt(), wh.value( 1 ).toInt() );
+    if ( size.isEmpty() ) {
+      qWarning( "Invalid frame size %s", qPrintable( parser.value( sizeOption ) ) );
+      return 1;
+    }
+    const QString format = parser.value( formatOption );
+    if ( format != "png" && format != "raw" ) {
+      qWarning( "Invalid frame format %s", qPrintable( format ) );
+      return 1;
+    }
+    bool ok = false;
+    const int frames = parser.value( framesOption ).toInt( &ok );
+    if ( ! ok || frames <= 0 ) {
+      qWarning( "Invalid number of frames %s", qPrintable( parser.value( framesOption ) ) );
+      return 1;
+    }
+    // Frames are not shown in real time, hence are simulated in full quality.
+    logical_scene->budget = 0.0;
+    OffscreenRenderer renderer( size, QImage( BackgroundSrc ),
+                                parser.value( exportOption ),
+                                format == "raw"
+                                ? OffscreenRenderer::Raw : OffscreenRenderer::Png );
+    for ( int i = 0; i < frames; ++i ) {
+      logical_scene->tick();
+      renderer.capture( *logical_scene );
+    }
+    renderer.finish();
+    return 0;
   }
 
   // Standard stuff to initialize a graphics view with some background.
@@ -119,10 +186,31 @@ int main(int argc, char **argv)
   view.resize( IMAGE_SIZE, IMAGE_SIZE );
   view.show();
 
-  // Creates a timer that will call `advance()` method regularly.
+  // Creates a timer that will call `tick()` method regularly.
   QTimer timer;
-  QObject::connect(&timer, SIGNAL(timeout()), &graphical_scene, SLOT(advance()));
+  QObject::connect(&timer, &QTimer::timeout, [] () { logical_scene->tick(); });
   timer.start( GameRefresh ); // every 30ms
+
+  // Reports the quality traded for latency, while it is traded or if it
+  // has been since the last report.
+  QTimer report;
+  QObject::connect(&report, &QTimer::timeout, [] () {
+      static SceneMetrics last = SceneMetrics();
+      const SceneMetrics& m = logical_scene->metrics;
+      const bool changed = m.overruns != last.overruns
+        || m.tested_reductions != last.tested_reductions
+        || m.spread_increases != last.spread_increases
+        || m.deferred_checks != last.deferred_checks;
+      last = m;
+      if ( ! changed && ! logical_scene->degraded() ) return;
+      qInfo( "%ld ticks, %ld over budget: %d random points (lowered %ld times), "
+             "stable shapes checked less often %ld times (%ld deferred checks); "
+             "last tick %.2f ms moving, %.2f ms colliding, %.2f ms committing",
+             m.ticks, m.overruns, logical_scene->nb_tested, m.tested_reductions,
+             m.spread_increases, m.deferred_checks,
+             m.movement_ms, m.collision_ms, m.commit_ms );
+    });
+  report.start( MetricsPeriod );
   
   return app.exec();
 }
@@ -8,19 +8,85 @@
 
 #include <cmath>
 #include <cassert>
+#include <algorithm>
 #include <QGraphicsScene>
 #include <QRandomGenerator>
+#include <QElapsedTimer>
+#include <QtMath>
 #include <QPainter>
 #include <QPixmap>
 #include <QBitmap>
 #include <QStyleOption>
 #include "objects.hpp"
 
+// Stable shapes are checked at least once every MAX_SPREAD ticks.
+static const int MAX_SPREAD = 8;
+
 // Global variables for simplicity.
 static QRandomGenerator RG;
 LogicalScene* logical_scene = 0;
 
 
+///////////////////////////////////////////////////////////////////////////////
+// class GraphicalShape
+///////////////////////////////////////////////////////////////////////////////
+
+GraphicalShape::GraphicalShape()
+  : _bbox_valid( false )
+{
+  // Needed so that `itemChange` is told about position and rotation changes.
+  setFlag( QGraphicsItem::ItemSendsGeometryChanges );
+}
+
+void
+GraphicalShape::invalidateBoundingRect()
+{
+  _bbox_valid = false;
+  // The bounding rectangles of the ancestors depend on this one. An
+  // ancestor that is already outdated has outdated its own ancestors,
+  // hence we may stop there.
+  auto parent = dynamic_cast< GraphicalShape* >( parentItem() );
+  while ( parent != 0 && parent->_bbox_valid ) {
+    parent->_bbox_valid = false;
+    parent = dynamic_cast< GraphicalShape* >( parent->parentItem() );
+  }
+}
+
+void
+GraphicalShape::record( std::vector< Sprite >& sprites ) const
+{
+  for ( auto child : childItems() ) {
+    auto shape = dynamic_cast< const GraphicalShape* >( child );
+    if ( shape != 0 ) shape->record( sprites );
+  }
+}
+
+QVariant
+GraphicalShape::itemChange( GraphicsItemChange change, const QVariant& value )
+{
+  switch ( change ) {
+  case ItemPositionHasChanged:
+  case ItemRotationHasChanged:
+  case ItemScaleHasChanged:
+  case ItemTransformHasChanged:
+  case ItemTransformOriginPointHasChanged:
+    invalidateBoundingRect();
+    break;
+  case ItemParentChange:
+  case ItemParentHasChanged:
+    {
+      // Both the former and the new parent lose or gain a part.
+      auto parent = dynamic_cast< GraphicalShape* >( parentItem() );
+      if ( parent != 0 ) parent->invalidateBoundingRect();
+    }
+    break;
+  default:
+    break;
+  }
+  return QGraphicsItem::itemChange( change, value );
+}
+
+
 ///////////////////////////////////////////////////////////////////////////////
 // class Disk
 ///////////////////////////////////////////////////////////////////////////////
@@ -58,6 +124,17 @@ Disk::paint(QPainter *painter, const QStyleOptionGraphicsItem *, QWidget *)
   painter->drawEllipse( QPointF( 0.0, 0.0 ), _r, _r );
 }
 
+void
+Disk::record( std::vector< Sprite >& sprites ) const
+{
+  Sprite s;
+  s.kind      = Sprite::Ellipse;
+  s.transform = sceneTransform();
+  s.rect      = boundingRect();
+  s.color     = _master_shape->currentColor();
+  sprites.push_back( s );
+}
+
 
 ///////////////////////////////////////////////////////////////////////////////
 // class Rectangle
@@ -92,13 +169,25 @@ Rectangle::paint(QPainter *painter, const QStyleOptionGraphicsItem *, QWidget *)
   painter->drawRect( _rect );
 }
 
+void
+Rectangle::record( std::vector< Sprite >& sprites ) const
+{
+  Sprite s;
+  s.kind      = Sprite::Rect;
+  s.transform = sceneTransform();
+  s.rect      = _rect;
+  s.color     = _master_shape->currentColor();
+  sprites.push_back( s );
+}
+
 
 ///////////////////////////////////////////////////////////////////////////////
 // class MasterShape
 ///////////////////////////////////////////////////////////////////////////////
 
-MasterShape::MasterShape( QColor cok, QColor cko )
-  : _f( 0 ), _state( Ok ), _cok( cok ), _cko( cko )
+MasterShape::MasterShape( QColor cok, QColor cko, double speed, double spin )
+  : _f( 0 ), _state( Ok ), _cok( cok ), _cko( cko ),
+    _speed( speed ), _spin( spin )
 {
 }
 
@@ -122,6 +211,18 @@ MasterShape::currentState() const
   return _state;
 }
 
+double
+MasterShape::speed() const
+{
+  return _speed;
+}
+
+double
+MasterShape::spin() const
+{
+  return _spin;
+}
+
 void
 MasterShape::paint( QPainter *, const QStyleOptionGraphicsItem *, QWidget *)
 {
@@ -129,41 +230,15 @@ MasterShape::paint( QPainter *, const QStyleOptionGraphicsItem *, QWidget *)
 }
 
 void
-MasterShape::advance(int step) 
-{
-  if ( !step ) return;
-
-  // (I) Garde les objets dans la scene.  
-  auto p = scenePos(); // pareil que pos si MasterShape est bien à la racine.
-  // pos() est dans les coordonnées parent et setPos aussi.
-  if ( p.x() < -SZ_BD ) {
-    auto point = parentItem() != 0
-      ? parentItem()->mapFromScene( QPointF( IMAGE_SIZE + SZ_BD - 1, p.y() ) )
-      : QPointF( IMAGE_SIZE + SZ_BD - 1, p.y() );
-    setPos(point);
-  } else if ( p.x() > IMAGE_SIZE + SZ_BD ) {
-    auto point = parentItem() != 0
-      ? parentItem()->mapFromScene( QPointF( -SZ_BD + 1, p.y() ) )
-      : QPointF( -SZ_BD + 1, p.y() );
-    setPos(point);
-  }
-  if ( p.y() < -SZ_BD ) {
-    auto point = parentItem() != 0 ?
-      parentItem()->mapFromScene( QPointF( p.x(), IMAGE_SIZE + SZ_BD - 1 ) )
-      : QPointF( p.x(), IMAGE_SIZE + SZ_BD - 1 );
-    setPos(point);
-  } else if ( p.y() > IMAGE_SIZE + SZ_BD ) {
-    auto point = parentItem() != 0
-      ? parentItem()->mapFromScene( QPointF( p.x(), -SZ_BD + 1 ) )
-      : QPointF( p.x(), -SZ_BD + 1 );
-    setPos(point);
-  }
+MasterShape::animate()
+{
+  // nothing to do, most shapes are rigid.
+}
 
-  // (II) regarde les intersections avec les autres objets.
-  if ( logical_scene->intersect( this ) )
-    _state = Collision;
-  else
-    _state = Ok;
+void
+MasterShape::setState( State s )
+{
+  _state = s;
 }
 
 QPointF
@@ -184,7 +259,11 @@ QRectF
 MasterShape::boundingRect() const
 {
   assert( _f != 0 );
-  return mapRectToParent( _f->boundingRect() );
+  if ( ! _bbox_valid ) {
+    _bbox       = mapRectToParent( _f->boundingRect() );
+    _bbox_valid = true;
+  }
+  return _bbox;
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -221,9 +300,13 @@ bool Union::isInside(const QPointF &p) const
 QRectF
 Union::boundingRect() const
 {
-  QRectF f1 = mapRectToParent( _f1.boundingRect() );
-  QRectF f2 = mapRectToParent( _f2.boundingRect() );
-  return f1 | f2;
+  if ( ! _bbox_valid ) {
+    QRectF f1 = mapRectToParent( _f1.boundingRect() );
+    QRectF f2 = mapRectToParent( _f2.boundingRect() );
+    _bbox       = f1 | f2;
+    _bbox_valid = true;
+  }
+  return _bbox;
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -252,18 +335,22 @@ void Transformation::paint( QPainter *, const QStyleOptionGraphicsItem *, QWidge
 
 QPointF Transformation::randomPoint() const
 {
-    return _dx + _f.randomPoint();
+    return mapToParent( _f.randomPoint() );
 }
 
 bool Transformation::isInside(const QPointF &p) const
 {
-    return _f.isInside( p - _dx );
+    return _f.isInside( mapFromParent( p ) );
 }
 
 QRectF
 Transformation::boundingRect() const
 {
-    return mapRectToParent( _f.boundingRect() );
+    if ( ! _bbox_valid ) {
+        _bbox       = mapRectToParent( _f.boundingRect() );
+        _bbox_valid = true;
+    }
+    return _bbox;
 }
 
 void Transformation::setAngle( qreal angle )
@@ -275,23 +362,122 @@ void Transformation::setAngle( qreal angle )
 // class ImageShape
 ///////////////////////////////////////////////////////////////////////////////
 
-ImageShape::ImageShape( const QPixmap & pixmap, const MasterShape* master_shape )
-    : _pixmap( pixmap ), _master_shape( master_shape )
+const SpriteAtlas*
+SpriteAtlas::get( const QPixmap & pixmap, QColor tint )
+{
+    static std::map< std::pair< qint64, QRgb >, SpriteAtlas > atlases;
+    auto key = std::make_pair( pixmap.cacheKey(), tint.rgba() );
+    auto it  = atlases.find( key );
+    if ( it == atlases.end() )
+        it = atlases.emplace( key, SpriteAtlas( pixmap, tint, SPRITE_ANGLES ) ).first;
+    return &it->second;
+}
+
+SpriteAtlas::SpriteAtlas( const QPixmap & pixmap, QColor tint, int nb_angles )
+    : _nb_angles( nb_angles )
+{
+    // A frame is off by at most half a step, i.e. its farthest point moves
+    // by the diagonal times the sine of half a step, plus rounding.
+    const qreal diagonal = std::hypot( pixmap.width(), pixmap.height() );
+    _margin = std::ceil( diagonal * std::sin( qDegreesToRadians( 180.0 / nb_angles ) ) ) + 1.0;
+    std::vector< QImage > tinted_images;
+    for ( int k = 0; k < nb_angles; ++k ) {
+        const qreal angle = k * 360.0 / nb_angles;
+        QTransform t;
+        t.rotate( angle );
+        const QRect r = t.mapRect( QRectF( pixmap.rect() ) ).toAlignedRect();
+        QImage img( r.size(), QImage::Format_ARGB32_Premultiplied );
+        img.fill( Qt::transparent );
+        QPainter painter( &img );
+        painter.setRenderHint( QPainter::Antialiasing );
+        painter.setRenderHint( QPainter::SmoothPixmapTransform );
+        painter.translate( -r.x(), -r.y() );
+        painter.rotate( angle );
+        painter.drawPixmap( QPointF( 0.0, 0.0 ), pixmap );
+        painter.end();
+        _images.push_back( img );
+        // Tints only the opaque part of the image, half transparent.
+        painter.begin( &img );
+        painter.setCompositionMode( QPainter::CompositionMode_SourceAtop );
+        painter.setOpacity( 0.5 );
+        painter.fillRect( img.rect(), tint );
+        painter.end();
+        tinted_images.push_back( img );
+        _offsets.push_back( r.topLeft() );
+    }
+    _images.insert( _images.end(), tinted_images.begin(), tinted_images.end() );
+    for ( const QImage& img : _images )
+        _pixmaps.push_back( QPixmap::fromImage( img ) );
+}
+
+int
+SpriteAtlas::frame( qreal angle, bool tinted, QPoint& offset ) const
+{
+    int k = qRound( angle * _nb_angles / 360.0 ) % _nb_angles;
+    if ( k < 0 ) k += _nb_angles;
+    offset = _offsets[ k ];
+    return tinted ? k + _nb_angles : k;
+}
+
+const QPixmap&
+SpriteAtlas::pixmap( int k ) const
+{
+    return _pixmaps[ k ];
+}
+
+const QImage&
+SpriteAtlas::image( int k ) const
+{
+    return _images[ k ];
+}
+
+qreal
+SpriteAtlas::margin() const
+{
+    return _margin;
+}
+
+ImageShape::ImageShape( const QPixmap & pixmap, const MasterShape* master_shape,
+                        QColor tint )
+    : _pixmap( pixmap ), _master_shape( master_shape ),
+      _atlas( SpriteAtlas::get( pixmap, tint ) )
 {
     _mask = _pixmap.mask();
     _mask_img = QImage( _mask.toImage().convertToFormat( QImage::Format_Mono ) );
 };
 
+int ImageShape::frame( const QTransform& t, QPoint& position ) const
+{
+    // Picks the pre-rotated frame closest to the rotation of \a t.
+    const qreal angle = qRadiansToDegrees( std::atan2( t.m12(), t.m11() ) );
+    QPoint offset;
+    const int k =
+        _atlas->frame( angle, _master_shape->currentState() == MasterShape::Collision,
+                       offset );
+    position = t.map( QPointF( 0.0, 0.0 ) ).toPoint() + offset;
+    return k;
+}
+
 void ImageShape::paint( QPainter *painter, const QStyleOptionGraphicsItem *, QWidget *)
 {
-    painter->drawPixmap( QPointF( 0.0, 0.0 ), _pixmap );
-    if ( _master_shape->currentState() == MasterShape::Collision )
-    {
-        painter->setOpacity( 0.5 );
-        painter->setBackgroundMode( Qt::TransparentMode );
-        painter->setPen  ( _master_shape->currentColor() );
-        painter->drawPixmap( QPointF( 0.0, 0.0 ), _mask );
-    }
+    // The painter is rotated like the image: instead of drawing through
+    // this rotation, blits the closest pre-rotated frame at the right place.
+    QPoint position;
+    const int k = frame( painter->worldTransform(), position );
+    painter->save();
+    painter->resetTransform();
+    painter->drawPixmap( position, _atlas->pixmap( k ) );
+    painter->restore();
+}
+
+void ImageShape::record( std::vector< Sprite >& sprites ) const
+{
+    Sprite s;
+    QPoint position;
+    s.kind  = Sprite::Image;
+    s.image = _atlas->image( frame( sceneTransform(), position ) );
+    s.rect  = QRectF( position, s.image.size() );
+    sprites.push_back( s );
 }
 
 QPointF ImageShape::randomPoint() const
@@ -312,7 +498,9 @@ bool ImageShape::isInside(const QPointF &p) const
 QRectF
 ImageShape::boundingRect() const
 {
-    return _mask_img.rect();
+    // Enlarged so that Qt repaints all the pixels of an approximate frame.
+    const qreal m = _atlas->margin();
+    return QRectF( _mask_img.rect() ).adjusted( -m, -m, m, m );
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -320,7 +508,7 @@ ImageShape::boundingRect() const
 ///////////////////////////////////////////////////////////////////////////////
 
 Asteroid::Asteroid( QColor cok, QColor cko, double speed, double r )
-  : MasterShape( cok, cko ), _speed( speed )
+  : MasterShape( cok, cko, speed, 0.0 )
 {
   // This shape is very simple : just a disk.
   Disk* d = new Disk( r, this );
@@ -328,45 +516,37 @@ Asteroid::Asteroid( QColor cok, QColor cko, double speed, double r )
   this->setGraphicalShape( d );
 }
 
-void
-Asteroid::advance(int step)
-{
-  if (!step) return;
-  setPos( mapToParent( _speed, 0.0 ) );
-  MasterShape::advance( step );
-}
-
-
-
 ///////////////////////////////////////////////////////////////////////////////
 // class NiceAsteroid
 ///////////////////////////////////////////////////////////////////////////////
 
 NiceAsteroid::NiceAsteroid( QColor cok, QColor cko, double speed, double r )
-  : MasterShape( cok, cko ), _speed( speed )
+  : MasterShape( cok, cko, speed, 0.0 )
 {
-    QPixmap asteroid_pixmap(":/images/asteroid.gif");
+    Q_UNUSED( r );
+    // Loaded once, so that all the asteroids share the same sprite atlas.
+    static const QPixmap asteroid_pixmap(":/images/asteroid.gif");
 
-    Asteroid asteroid( cok, cko, speed, r );
-    Asteroid* tmp_asteroid = &asteroid;
-
-    // This shape is very simple : just a disk.
-    ImageShape* i = new ImageShape( asteroid_pixmap, tmp_asteroid );
+    // This shape is very simple : just an image, which gets the color of
+    // this asteroid in case of collision.
+    ImageShape* i = new ImageShape( asteroid_pixmap, this, cko );
 
     _t1 = new Transformation( *i, QPointF(0.0,0.0) );
     _t2 = new Transformation( *i, QPointF( 0.0, 0.0 ), 2.0 );
+    // The image spins about its centre, not about its top-left corner.
+    _t2->setTransformOriginPoint( QRectF( asteroid_pixmap.rect() ).center() );
 
     // Tells the asteroid that it is composed of just a disk.
     this->setGraphicalShape( _t2 );
 }
 
 void
-NiceAsteroid::advance(int step)
+NiceAsteroid::animate()
 {
-    if (!step) return;
-    setPos( mapToParent( _speed, 0.0 ) );
     _t2->setAngle( _t2->_angle + 2.0 );
-    MasterShape::advance( step );
+    // setAngle only stores the angle: the image and its collision body
+    // actually turn here.
+    _t2->setRotation( _t2->_angle );
 }
 
 
@@ -376,7 +556,7 @@ NiceAsteroid::advance(int step)
 ///////////////////////////////////////////////////////////////////////////////
 
 SpaceTruck::SpaceTruck( QColor cok, QColor cko, double speed )
-  : MasterShape( cok, cko ), _speed( speed )
+  : MasterShape( cok, cko, speed, 1.0 )
 {
   // This shape is very simple : just a disk.
   Rectangle* d1 = new Rectangle( QPointF( -80, -10 ), QPointF( 0, 10 ), this );
@@ -389,23 +569,12 @@ SpaceTruck::SpaceTruck( QColor cok, QColor cko, double speed )
   this->setGraphicalShape( u );
 }
 
-void
-SpaceTruck::advance(int step)
-{
-  if (!step) return;
-  setPos( mapToParent( _speed, 0.0 ) );
-  MasterShape::advance( step );
-  MasterShape::setRotation( MasterShape::rotation() + 1 % 360 );
-}
-
-
-
 ///////////////////////////////////////////////////////////////////////////////
 // class Enterprise
 ///////////////////////////////////////////////////////////////////////////////
 
 Enterprise::Enterprise( QColor cok, QColor cko, double speed )
-  : MasterShape( cok, cko ), _speed( speed )
+  : MasterShape( cok, cko, speed, 0.0 )
 {
     Rectangle*      r1 = new Rectangle( QPointF( -100, -8 ), QPointF( 0, 8 ), this );
     Rectangle*      r2 = new Rectangle( QPointF( -100, -8 ), QPointF( 0, 8 ), this );
@@ -428,23 +597,204 @@ Enterprise::Enterprise( QColor cok, QColor cko, double speed )
     this->setGraphicalShape( all );
 }
 
+///////////////////////////////////////////////////////////////////////////////
+// class LogicalScene
+///////////////////////////////////////////////////////////////////////////////
+
+LogicalScene::LogicalScene( int n )
+  : nb_tested( n ), min_tested( n ), stable_ticks( 10 ), budget( 0.0 ),
+    metrics(), nb_cells_x( 0 ), nb_cells_y( 0 ),
+    _max_tested( n ), _spread( 1 ) {}
+
 void
-Enterprise::advance(int step)
+LogicalScene::setGrid( int nx, int ny )
 {
-  if (!step) return;
-  setPos( mapToParent( _speed, 0.0 ) );
-  MasterShape::advance( step );
+  assert( nx > 0 && ny > 0 );
+  nb_cells_x = nx;
+  nb_cells_y = ny;
+  cells.clear();
+  cells.resize( nx * ny );
+  _cells_of.clear();
+  for ( auto f : formes ) updateCells( f );
 }
 
+void
+LogicalScene::add( MasterShape* f )
+{
+  formes.push_back( f );
+  // Qt rotations are clockwise on screen: heading is (cos a, sin a).
+  const double a = qDegreesToRadians( f->rotation() );
+  const double s = qDegreesToRadians( f->spin() );
+  _x.push_back( f->pos().x() );
+  _y.push_back( f->pos().y() );
+  _vx.push_back( f->speed() * std::cos( a ) );
+  _vy.push_back( f->speed() * std::sin( a ) );
+  _angle.push_back( f->rotation() );
+  _spin.push_back( f->spin() );
+  _cos_spin.push_back( std::cos( s ) );
+  _sin_spin.push_back( std::sin( s ) );
+  _stable.push_back( 0 );
+  if ( ! cells.empty() ) updateCells( f );
+}
+
+// Advances the \a n shapes whose kinematic state is given by one step, see
+// LogicalScene::integrate. The arrays are parameters declared not to
+// overlap, which is what lets the compiler vectorize this loop.
+static void
+integrateKinematics( std::size_t n, double* __restrict x, double* __restrict y,
+                     double* __restrict vx, double* __restrict vy,
+                     double* __restrict angle, const double* __restrict spin,
+                     const double* __restrict cos_spin,
+                     const double* __restrict sin_spin )
+{
+  const double lo = -SZ_BD;
+  const double hi = IMAGE_SIZE + SZ_BD;
+  // Selections instead of branches keep this loop vectorizable.
+  for ( std::size_t i = 0; i < n; ++i ) {
+    double px = x[ i ] + vx[ i ];
+    double py = y[ i ] + vy[ i ];
+    px = px < lo ? hi - 1 : ( px > hi ? lo + 1 : px );
+    py = py < lo ? hi - 1 : ( py > hi ? lo + 1 : py );
+    x[ i ] = px;
+    y[ i ] = py;
+    // The shape moves first, then turns.
+    const double v = vx[ i ] * cos_spin[ i ] - vy[ i ] * sin_spin[ i ];
+    vy[ i ]    = vx[ i ] * sin_spin[ i ] + vy[ i ] * cos_spin[ i ];
+    vx[ i ]    = v;
+    angle[ i ] += spin[ i ];
+  }
+}
 
+void
+LogicalScene::integrate()
+{
+  integrateKinematics( formes.size(), _x.data(), _y.data(), _vx.data(), _vy.data(),
+                       _angle.data(), _spin.data(), _cos_spin.data(),
+                       _sin_spin.data() );
+}
 
-///////////////////////////////////////////////////////////////////////////////
-// class LogicalScene
-///////////////////////////////////////////////////////////////////////////////
+void
+LogicalScene::applyPoses()
+{
+  for ( std::size_t i = 0; i < formes.size(); ++i ) {
+    formes[ i ]->setPos( _x[ i ], _y[ i ] );
+    if ( _spin[ i ] != 0.0 ) formes[ i ]->setRotation( _angle[ i ] );
+  }
+}
+
+int
+LogicalScene::cellOf( const QPointF& p ) const
+{
+  // The world is the torus [-SZ_BD,IMAGE_SIZE+SZ_BD]^2.
+  const qreal w = ( IMAGE_SIZE + 2.0 * SZ_BD ) / nb_cells_x;
+  const qreal h = ( IMAGE_SIZE + 2.0 * SZ_BD ) / nb_cells_y;
+  int i = int( std::floor( ( p.x() + SZ_BD ) / w ) );
+  int j = int( std::floor( ( p.y() + SZ_BD ) / h ) );
+  // Points outside the world belong to the border cells.
+  i = std::min( std::max( i, 0 ), nb_cells_x - 1 );
+  j = std::min( std::max( j, 0 ), nb_cells_y - 1 );
+  return j * nb_cells_x + i;
+}
+
+std::vector< int >
+LogicalScene::cellsOf( const QRectF& r ) const
+{
+  std::vector< int > result;
+  const int first = cellOf( r.topLeft() );
+  const int last  = cellOf( QPointF( r.right(), r.bottom() ) );
+  for ( int j = first / nb_cells_x; j <= last / nb_cells_x; ++j )
+    for ( int i = first % nb_cells_x; i <= last % nb_cells_x; ++i )
+      result.push_back( j * nb_cells_x + i );
+  return result;
+}
+
+void
+LogicalScene::updateCells( MasterShape* f )
+{
+  if ( cells.empty() ) return;
+  std::vector< int > now = cellsOf( f->boundingRect() );
+  std::vector< int >& before = _cells_of[ f ];
+  if ( now == before ) return;
+  for ( int k : before ) {
+    auto& v = cells[ k ];
+    v.erase( std::find( v.begin(), v.end(), f ) );
+  }
+  for ( int k : now ) cells[ k ].push_back( f );
+  before.swap( now );
+}
+
+void
+LogicalScene::tick()
+{
+  QElapsedTimer timer;
+  timer.start();
+  // (I) movement: every shape moves, its graphics item takes the new pose,
+  // then its parts move and its cells are updated.
+  integrate();
+  applyPoses();
+  for ( auto f : formes ) {
+    f->animate();
+    updateCells( f );
+  }
+  const qint64 t1 = timer.nsecsElapsed();
+  // (II) collision: states are computed from the poses of this tick only.
+  // Under load, stable shapes take turns to be checked.
+  _next_states.resize( formes.size() );
+  for ( std::size_t i = 0; i < formes.size(); ++i ) {
+    if ( _spread > 1 && _stable[ i ] >= stable_ticks
+         && ( i + metrics.ticks ) % _spread != 0 ) {
+      _next_states[ i ] = formes[ i ]->currentState();
+      ++metrics.deferred_checks;
+      continue;
+    }
+    _next_states[ i ] = intersect( formes[ i ] )
+      ? MasterShape::Collision : MasterShape::Ok;
+  }
+  const qint64 t2 = timer.nsecsElapsed();
+  // (III) commit.
+  for ( std::size_t i = 0; i < formes.size(); ++i ) {
+    if ( _next_states[ i ] == formes[ i ]->currentState() ) ++_stable[ i ];
+    else                                                     _stable[ i ] = 0;
+    formes[ i ]->setState( _next_states[ i ] );
+  }
+  const qint64 t3 = timer.nsecsElapsed();
+
+  ++metrics.ticks;
+  metrics.movement_ms  = t1 * 1e-6;
+  metrics.collision_ms = ( t2 - t1 ) * 1e-6;
+  metrics.commit_ms    = ( t3 - t2 ) * 1e-6;
+  schedule( t3 * 1e-6 );
+}
+
+bool
+LogicalScene::degraded() const
+{
+  return nb_tested < _max_tested || _spread > 1;
+}
+
+void
+LogicalScene::schedule( double elapsed )
+{
+  if ( budget <= 0.0 ) return;
+  if ( elapsed > budget ) {
+    ++metrics.overruns;
+    // First fewer random points, then fewer checks of the stable shapes.
+    if ( nb_tested > min_tested ) {
+      nb_tested = std::max( min_tested, nb_tested / 2 );
+      ++metrics.tested_reductions;
+    } else if ( _spread < MAX_SPREAD ) {
+      _spread *= 2;
+      ++metrics.spread_increases;
+    }
+  } else if ( elapsed < budget / 2.0 ) {
+    // Restores the quality in the reverse order.
+    if ( _spread > 1 )
+      _spread /= 2;
+    else if ( nb_tested < _max_tested )
+      nb_tested = std::min( _max_tested, nb_tested * 2 );
+  }
+}
 
-LogicalScene::LogicalScene( int n )
-  : nb_tested( n ) {}
-    
 bool
 LogicalScene::intersect( MasterShape* f1, MasterShape* f2 )
 {
@@ -460,9 +810,22 @@ LogicalScene::intersect( MasterShape* f1, MasterShape* f2 )
 bool
 LogicalScene::intersect( MasterShape* f1 )
 {
-  for ( auto f : formes )
+  if ( cells.empty() ) {
+    for ( auto f : formes )
+      if ( ( f != f1 ) && intersect( f, f1 ) )
+        return true;
+    return false;
+  }
+  // Any shape that overlaps f1 shares a cell with it. A shape sharing
+  // several cells with f1 is tested only once, as in the loop above.
+  _candidates.clear();
+  for ( int k : cellsOf( f1->boundingRect() ) )
+    _candidates.insert( _candidates.end(), cells[ k ].begin(), cells[ k ].end() );
+  std::sort( _candidates.begin(), _candidates.end() );
+  _candidates.erase( std::unique( _candidates.begin(), _candidates.end() ),
+                     _candidates.end() );
+  for ( auto f : _candidates )
     if ( ( f != f1 ) && intersect( f, f1 ) )
       return true;
   return false;
 }
-
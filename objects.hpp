@@ -9,22 +9,59 @@
 #ifndef OBJECTS_HPP
 #define OBJECTS_HPP
 
+#include <map>
 #include <vector>
 #include <QGraphicsItem>
 #include <QBitmap>
+#include <QImage>
+#include <QTransform>
 
 static const int IMAGE_SIZE = 600;
 static const int SZ_BD      = 100;
+// Number of pre-rotated frames of each image (one every 5 degrees).
+static const int SPRITE_ANGLES = 72;
 
 
+/// @brief What a simple shape paints, in scene coordinates, so that it may
+/// be painted again away from the graphics scene, e.g. in another thread.
+struct Sprite {
+  enum Kind { Ellipse, Rect, Image };
+  Kind       kind;
+  // From the shape to the scene.
+  QTransform transform;
+  // The ellipse or rectangle, or where the image goes.
+  QRectF     rect;
+  QColor     color;
+  QImage     image;
+};
+
 /// @brief Abstract class that describes a graphical object with additional
 /// methods for testing collisions.
 struct GraphicalShape : public QGraphicsItem
 {
+  GraphicalShape();
   virtual QPointF randomPoint() const = 0;
   virtual bool    isInside( const QPointF& p ) const = 0;
   // Already in QGraphicsItem
   // virtual QRectF  boundingRect() const override;
+
+  /// Appends to \a sprites what this shape paints, in painting order. By
+  /// default, appends what its child shapes paint.
+  virtual void    record( std::vector< Sprite >& sprites ) const;
+
+  /// Marks the cached bounding rectangle of this shape and of all its
+  /// ancestors as outdated. It is called whenever the pose of this
+  /// shape changes.
+  void            invalidateBoundingRect();
+
+protected:
+  // Catches position and rotation changes to invalidate bounding rectangles.
+  virtual QVariant itemChange( GraphicsItemChange change,
+                               const QVariant& value ) override;
+
+  // Cached bounding rectangle, only meaningful when `_bbox_valid` is true.
+  mutable QRectF  _bbox;
+  mutable bool    _bbox_valid;
 };
 
 
@@ -36,7 +73,9 @@ struct GraphicalShape : public QGraphicsItem
 struct MasterShape : public GraphicalShape
 {
   enum State { Ok, Collision };
-  MasterShape( QColor cok, QColor cko );
+  /// Builds a master shape that moves forward by \a speed pixels and turns
+  /// by \a spin degrees at each step.
+  MasterShape( QColor cok, QColor cko, double speed, double spin );
   void setGraphicalShape( GraphicalShape* f );
   virtual void    paint( QPainter *painter, const QStyleOptionGraphicsItem *option,
                          QWidget *widget) override;
@@ -44,16 +83,20 @@ struct MasterShape : public GraphicalShape
   virtual bool    isInside( const QPointF& p ) const override;
   virtual QRectF  boundingRect() const override;
 
-  // Checks if this shape collides with another shape and forces also
-  // the shapes to stay in the graphical view.
-  virtual void    advance(int step) override;
+  // Moves the parts of this shape at each step. Moving the shape itself
+  // is done by the logical scene, see `LogicalScene::integrate`.
+  virtual void    animate();
   State           currentState() const;
+  void            setState( State s );
   QColor          currentColor() const;
+  double          speed() const;
+  double          spin() const;
 
 protected:
   GraphicalShape* _f;
   State           _state;
   QColor          _cok, _cko;
+  double          _speed, _spin;
 };
 
 /// @brief Merge two shapes to create a more complex shape.
@@ -92,40 +135,80 @@ struct Transformation: public GraphicalShape
     void setAngle( qreal angle );
 };
 
+/// @brief An image rotated once and for all by evenly spaced angles.
+///
+/// Each frame also exists tinted with a collision color, so that painting
+/// a rotated image, in collision or not, is a plain blit. Frames are kept
+/// as pixmaps, the fastest to paint on screen, and as images, which may be
+/// painted in any thread by the offscreen renderer.
+struct SpriteAtlas
+{
+    /// Returns the atlas of \a pixmap tinted with \a tint, building it at
+    /// the first call. Atlases are shared by all the images using them.
+    static const SpriteAtlas* get( const QPixmap & pixmap, QColor tint );
+
+    SpriteAtlas( const QPixmap & pixmap, QColor tint, int nb_angles );
+    /// @param angle any angle in degrees.
+    /// @param tinted when 'true', returns the tinted frame.
+    /// @param[out] offset the position of the top-left corner of the
+    /// frame relatively to the origin of the image.
+    /// @return the index of the frame closest to \a angle.
+    int            frame( qreal angle, bool tinted, QPoint& offset ) const;
+    /// @return the frame number \a k as a pixmap, to paint on screen.
+    const QPixmap& pixmap( int k ) const;
+    /// @return the frame number \a k as an image, to paint offscreen.
+    const QImage&  image( int k ) const;
+    /// @return how far a frame may go beyond the image rotated by the
+    /// exact angle.
+    qreal margin() const;
+
+    int                   _nb_angles;
+    qreal                 _margin;
+    // Frames by angle, then the same frames tinted.
+    std::vector< QPixmap > _pixmaps;
+    std::vector< QImage >  _images;
+    std::vector< QPoint >  _offsets;
+};
+
 struct ImageShape: public GraphicalShape
 {
     const QPixmap _pixmap;
     const MasterShape* _master_shape;
     QBitmap _mask;
     QImage _mask_img;
+    const SpriteAtlas* _atlas;
 
-    ImageShape( const QPixmap & pixmap, const MasterShape* master_shape );
+    /// Builds an image, painted tinted with \a tint when \a master_shape
+    /// is in collision.
+    ImageShape( const QPixmap & pixmap, const MasterShape* master_shape,
+                QColor tint );
 
     virtual void paint( QPainter *painter, const QStyleOptionGraphicsItem *,
                            QWidget *) override;
     virtual QPointF randomPoint() const override;
     virtual bool isInside( const QPointF& p ) const override;
     virtual QRectF  boundingRect() const override;
+    virtual void record( std::vector< Sprite >& sprites ) const override;
+
+protected:
+    // Returns the index in the atlas of the frame to paint under the
+    // transform \a t and the position of its top-left corner once transformed.
+    int frame( const QTransform& t, QPoint& position ) const;
 };
 
 /// @brief An asteroid is a simple shape that moves linearly in some direction.
 struct Asteroid : public MasterShape
 {
   Asteroid( QColor cok, QColor cko, double speed, double r );
-  // moves the asteroid forward according to its speed.
-  virtual void    advance(int step) override;
-protected:
-  double          _speed;
 };
 
 /// @brief A NiceAsteroid is a simple shape that moves linearly in some direction.
 struct NiceAsteroid : public MasterShape
 {
   NiceAsteroid( QColor cok, QColor cko, double speed, double r );
-  // moves the asteroid forward according to its speed.
-  virtual void    advance(int step) override;
+  // spins the image of the asteroid.
+  virtual void    animate() override;
 protected:
-  double          _speed;
   Transformation* _t1;
   Transformation* _t2;
 };
@@ -134,20 +217,12 @@ protected:
 struct SpaceTruck : public MasterShape
 {
   SpaceTruck( QColor cok, QColor cko, double speed );
-  // moves the asteroid forward according to its speed.
-  virtual void    advance(int step) override;
-protected:
-  double          _speed;
 };
 
 /// @brief An enterprise is a simple shape that moves linearly in some direction.
 struct Enterprise : public MasterShape
 {
   Enterprise( QColor cok, QColor cko, double speed );
-  // moves the asteroid forward according to its speed.
-  virtual void    advance(int step) override;
-protected:
-  double          _speed;
 };
 
 /// @brief A disk is a simple graphical shape.
@@ -162,6 +237,7 @@ struct Disk : public GraphicalShape
   virtual QPointF randomPoint() const override;
   virtual bool    isInside( const QPointF& p ) const override;
   virtual QRectF  boundingRect() const override;
+  virtual void    record( std::vector< Sprite >& sprites ) const override;
   const qreal     _r;
   const MasterShape* _master_shape;
 };
@@ -178,21 +254,81 @@ struct Rectangle : public GraphicalShape
   virtual QPointF randomPoint() const override;
   virtual bool    isInside( const QPointF& p ) const override;
   virtual QRectF  boundingRect() const override;
+  virtual void    record( std::vector< Sprite >& sprites ) const override;
   const QRectF     _rect;
   const MasterShape* _master_shape;
 };
 
+/// @brief Counters of the collision quality traded for latency.
+struct SceneMetrics {
+  long   ticks;              // number of ticks so far
+  long   overruns;           // ticks that exceeded the budget
+  long   tested_reductions;  // times the number of random points was lowered
+  long   spread_increases;   // times stable shapes were checked less often
+  long   deferred_checks;    // collision checks postponed to a later tick
+  // Duration of each phase of the last tick, in ms.
+  double movement_ms, collision_ms, commit_ms;
+};
+
 /// @brief A class to store master shapes and to test their possible
 /// collisions with a randomized algorithm.
+///
+/// The world may be covered by a uniform grid of cells, so that a shape is
+/// only tested against the shapes whose bounding rectangle overlaps one of
+/// the cells its own bounding rectangle overlaps.
+///
+/// It also moves the shapes: their kinematic state is kept in arrays
+/// parallel to `formes`, so that all of them advance in one loop, and is
+/// then copied to the graphics items. The position and rotation of a
+/// stored shape must not be changed elsewhere.
+///
+/// The simulation is driven by `tick`, which only visits the stored
+/// master shapes and not their parts. When a tick takes longer than the
+/// budget, the next ones check collisions with fewer random points (down
+/// to `min_tested`), then check the shapes whose state has not changed for
+/// `stable_ticks` ticks less often. Quality is restored when ticks take
+/// less than half the budget. Every degradation is counted in `metrics`.
 struct LogicalScene {
   std::vector< MasterShape*> formes;
   int nb_tested;
+  int min_tested;
+  int stable_ticks;
+  double budget; // ms, 0 means no budget
+  SceneMetrics metrics;
+  // cells[ k ] lists the shapes whose bounding rectangle overlaps cell k.
+  std::vector< std::vector< MasterShape* > > cells;
+  int nb_cells_x, nb_cells_y;
 
   /// Builds a logical scene where collisions are detected by checking
   /// \a n random points within shapes.
   ///
   /// @param n any positive integer.
   LogicalScene( int n );
+  /// Covers the world with a grid of \a nx times \a ny cells and puts the
+  /// shapes already stored in this logical scene in their cells.
+  ///
+  /// @param nx,ny any positive integers.
+  void setGrid( int nx, int ny );
+  /// Stores the master shape \a f in this logical scene, starting from its
+  /// current position and rotation.
+  void add( MasterShape* f );
+  /// Moves every shape forward according to its speed, turns it according
+  /// to its spin and keeps it within the torus world. Only the kinematic
+  /// state kept by this logical scene changes, see `applyPoses`.
+  void integrate();
+  /// Gives every shape the position and rotation computed by `integrate`.
+  ///
+  /// This is what limits the throughput of the movement phase: each
+  /// setPos or setRotation goes through QGraphicsItem::itemChange and
+  /// invalidates the cached bounding rectangles of the shape.
+  void applyPoses();
+  /// Advances the simulation by one step, in three phases: all the shapes
+  /// move, then all the collisions are checked, then all the shapes take
+  /// their new state.
+  void tick();
+  /// Puts \a f in the cells its bounding rectangle overlaps. It must be
+  /// called after \a f has moved, before checking collisions.
+  void updateCells( MasterShape* f );
   /// Given two shapes \a f1 and \a f2, returns if they collide.
   /// @param f1 any master shape.
   /// @param f2 any different master shape.
@@ -201,6 +337,36 @@ struct LogicalScene {
   /// @param f1 any master shape.
   /// @return 'true' iff it collides with a different master shape stored in this logical scene.
   bool intersect( MasterShape* f1 );
+  /// @return 'true' iff collisions are currently checked with fewer random
+  /// points than `nb_tested` was given, or stable shapes less often.
+  bool degraded() const;
+
+protected:
+  // Index of the cell that contains \a p.
+  int  cellOf( const QPointF& p ) const;
+  // Indices of the cells that intersect \a r.
+  std::vector< int > cellsOf( const QRectF& r ) const;
+  // Trades quality for latency, or the converse, given the duration of
+  // the last tick in ms.
+  void schedule( double elapsed );
+
+  // For each shape, the cells it is in.
+  std::map< MasterShape*, std::vector< int > > _cells_of;
+  // The shapes that share a cell with the shape being checked.
+  std::vector< MasterShape* > _candidates;
+
+  // Kinematic state of `formes[i]`: position, velocity (heading times
+  // speed), rotation in degrees, spin in degrees and the cosine and sine
+  // of the spin.
+  std::vector< double > _x, _y, _vx, _vy, _angle, _spin, _cos_spin, _sin_spin;
+  // States computed by the collision phase of `tick`, before being committed.
+  std::vector< MasterShape::State > _next_states;
+  // For each shape, the number of ticks its state has not changed.
+  std::vector< int > _stable;
+  // The initial number of random points.
+  int _max_tested;
+  // Stable shapes are checked once every `_spread` ticks.
+  int _spread;
 };
 
 extern LogicalScene* logical_scene;
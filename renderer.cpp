@@ -0,0 +1,144 @@
+/****************************************************************************
+** Author: J.-O. Lachaud, University Savoie Mont Blanc
+** (adapted from Qt colliding mices example)
+**
+** Copyright (C) 2015 The Qt Company Ltd.
+** Contact: http://www.qt.io/licensing/
+****************************************************************************/
+
+#include <algorithm>
+#include <QDir>
+#include <QFile>
+#include <QPainter>
+#include <QThread>
+#include <QVector>
+#include <QtConcurrent>
+#include "renderer.hpp"
+
+// Size in pixels of the tiles of a frame.
+static const int TILE_SIZE = 128;
+// Quality given to QImage::save for PNG frames. Qt maps it to zlib level 1,
+// about 2.5 times faster to encode than the default, for 15% larger files.
+static const int PNG_QUALITY = 89;
+
+
+///////////////////////////////////////////////////////////////////////////////
+// class OffscreenRenderer
+///////////////////////////////////////////////////////////////////////////////
+
+OffscreenRenderer::OffscreenRenderer( const QSize& size, const QImage& background,
+                                      const QString& directory, Format format )
+  : _size( size ), _directory( directory ), _format( format ),
+    _tile( TILE_SIZE ), _index( 0 )
+{
+  QDir().mkpath( _directory );
+  // Fits the scene in the frame, centered.
+  const qreal s = std::min( size.width(), size.height() ) / qreal( IMAGE_SIZE );
+  _view = QTransform( s, 0.0, 0.0, s,
+                      ( size.width()  - s * IMAGE_SIZE ) / 2.0,
+                      ( size.height() - s * IMAGE_SIZE ) / 2.0 );
+  // Like the graphics view, tiles the background in scene coordinates.
+  _background = QImage( size, QImage::Format_ARGB32_Premultiplied );
+  QPainter painter( &_background );
+  painter.setTransform( _view );
+  painter.fillRect( _view.inverted().mapRect( QRectF( _background.rect() ) ),
+                    QBrush( background ) );
+  painter.end();
+  _frames.setMaxThreadCount( QThread::idealThreadCount() );
+}
+
+OffscreenRenderer::~OffscreenRenderer()
+{
+  finish();
+}
+
+void
+OffscreenRenderer::capture( const LogicalScene& scene )
+{
+  std::vector< Sprite > sprites;
+  for ( auto f : scene.formes ) f->record( sprites );
+  // Bounds the memory used by the frames in flight.
+  while ( int( _pending.size() ) >= 2 * QThread::idealThreadCount() ) {
+    _pending.front().waitForFinished();
+    _pending.pop_front();
+  }
+  const int index = _index++;
+  _pending.push_back( QtConcurrent::run( &_frames, [ this, sprites, index ] () {
+        render( sprites, index );
+      } ) );
+}
+
+void
+OffscreenRenderer::finish()
+{
+  for ( auto& f : _pending ) f.waitForFinished();
+  _pending.clear();
+}
+
+void
+OffscreenRenderer::render( const std::vector< Sprite >& sprites, int index ) const
+{
+  QImage frame( _size, QImage::Format_ARGB32_Premultiplied );
+  // Where each sprite lands in the frame, so that a tile only paints the
+  // sprites that touch it (plus one pixel for the pen).
+  std::vector< QRect > boxes;
+  for ( const Sprite& s : sprites )
+    boxes.push_back( ( s.transform * _view ).mapRect( s.rect ).toAlignedRect()
+                     .adjusted( -1, -1, 1, 1 ) );
+  QVector< QRect > tiles;
+  for ( int y = 0; y < _size.height(); y += _tile )
+    for ( int x = 0; x < _size.width(); x += _tile )
+      tiles.push_back( QRect( x, y, _tile, _tile ).intersected( frame.rect() ) );
+
+  // Each tile is an image sharing its part of the frame memory, so that
+  // tiles are painted in parallel without any copy.
+  uchar*    bits = frame.bits();
+  const int bpl  = frame.bytesPerLine();
+  QtConcurrent::blockingMap( tiles, [ & ] ( const QRect& r ) {
+      QImage tile( bits + r.y() * bpl + r.x() * 4, r.width(), r.height(), bpl,
+                   QImage::Format_ARGB32_Premultiplied );
+      QPainter painter( &tile );
+      painter.setCompositionMode( QPainter::CompositionMode_Source );
+      painter.drawImage( QPoint( 0, 0 ), _background, r );
+      painter.setCompositionMode( QPainter::CompositionMode_SourceOver );
+      painter.setRenderHint( QPainter::Antialiasing );
+      painter.setRenderHint( QPainter::SmoothPixmapTransform );
+      const QTransform shift = QTransform::fromTranslate( -r.x(), -r.y() );
+      for ( std::size_t i = 0; i < sprites.size(); ++i ) {
+        if ( ! boxes[ i ].intersects( r ) ) continue;
+        const Sprite& s = sprites[ i ];
+        painter.setTransform( s.transform * _view * shift );
+        switch ( s.kind ) {
+        case Sprite::Ellipse:
+          painter.setBrush( s.color );
+          painter.drawEllipse( s.rect );
+          break;
+        case Sprite::Rect:
+          painter.setBrush( s.color );
+          painter.drawRect( s.rect );
+          break;
+        case Sprite::Image:
+          painter.drawImage( s.rect.topLeft(), s.image );
+          break;
+        }
+      }
+    } );
+
+  const QString name = QString( "%1/frame_%2" ).arg( _directory )
+    .arg( index, 6, 10, QChar( '0' ) );
+  if ( _format == Png ) {
+    if ( ! frame.save( name + ".png", "PNG", PNG_QUALITY ) )
+      qWarning( "Cannot write %s.png", qPrintable( name ) );
+  } else {
+    // Raw frames are rows of RGB888 pixels, without padding.
+    const QImage rgb = frame.convertToFormat( QImage::Format_RGB888 );
+    QFile file( name + ".rgb" );
+    if ( ! file.open( QIODevice::WriteOnly ) ) {
+      qWarning( "Cannot write %s.rgb", qPrintable( name ) );
+      return;
+    }
+    for ( int y = 0; y < rgb.height(); ++y )
+      file.write( reinterpret_cast< const char* >( rgb.constScanLine( y ) ),
+                  3 * rgb.width() );
+  }
+}
@@ -0,0 +1,61 @@
+/****************************************************************************
+** Author: J.-O. Lachaud, University Savoie Mont Blanc
+** (adapted from Qt colliding mices example)
+**
+** Copyright (C) 2015 The Qt Company Ltd.
+** Contact: http://www.qt.io/licensing/
+****************************************************************************/
+
+#ifndef RENDERER_HPP
+#define RENDERER_HPP
+
+#include <deque>
+#include <vector>
+#include <QFuture>
+#include <QImage>
+#include <QString>
+#include <QThreadPool>
+#include "objects.hpp"
+
+/// @brief Renders a logical scene without any display and saves the frames
+/// as a sequence of PNG or raw RGB888 files.
+///
+/// Each captured frame is a list of the sprites the shapes paint at that
+/// time. It is then rendered by tiles on the global thread pool and
+/// written to disk in the background, while the simulation goes on.
+struct OffscreenRenderer
+{
+  enum Format { Png, Raw };
+
+  /// Builds a renderer of frames of size \a size, fitting the scene and
+  /// drawn over the tiled image \a background. The frames are written in
+  /// \a directory, which is created if needed.
+  OffscreenRenderer( const QSize& size, const QImage& background,
+                     const QString& directory, Format format );
+  /// Waits until all the captured frames are written.
+  ~OffscreenRenderer();
+  /// Takes a snapshot of the shapes of \a scene and renders it
+  /// asynchronously. Blocks if too many frames are still being rendered.
+  void capture( const LogicalScene& scene );
+  /// Waits until all the captured frames are written.
+  void finish();
+
+protected:
+  // Renders and writes the frame number \a index made of \a sprites.
+  void render( const std::vector< Sprite >& sprites, int index ) const;
+
+  QSize      _size;
+  // From the scene to the frame.
+  QTransform _view;
+  // The background of a whole frame, computed once.
+  QImage     _background;
+  QString    _directory;
+  Format     _format;
+  int        _tile;
+  int        _index;
+  // Runs one job per frame, tiles are rendered by the global pool.
+  QThreadPool _frames;
+  std::deque< QFuture< void > > _pending;
+};
+
+#endif